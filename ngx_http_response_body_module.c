@@ -3,6 +3,21 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_OPENSSL)
+#include <openssl/evp.h>
+#endif
+
+
+#define NGX_HTTP_RESPONSE_BODY_DIGEST_OFF     0
+#define NGX_HTTP_RESPONSE_BODY_DIGEST_CRC32   1
+#define NGX_HTTP_RESPONSE_BODY_DIGEST_FNV1A   2
+#define NGX_HTTP_RESPONSE_BODY_DIGEST_SHA256  3
+
+#define NGX_HTTP_RESPONSE_BODY_DIGEST_LEN     64
+
+#define NGX_HTTP_RESPONSE_BODY_FNV1A_OFFSET   0xcbf29ce484222325ULL
+#define NGX_HTTP_RESPONSE_BODY_FNV1A_PRIME    0x100000001b3ULL
+
 
 typedef struct {
     ngx_msec_t    latency;
@@ -16,6 +31,7 @@ typedef struct {
     size_t        buffer_size;
     ngx_flag_t    capture_body;
     ngx_str_t     capture_body_var;
+    ngx_uint_t    digest;
     ngx_array_t  *conditions;
     ngx_array_t  *cv;
 } ngx_http_response_body_loc_conf_t;
@@ -24,6 +40,18 @@ typedef struct {
 typedef struct {
     ngx_http_response_body_loc_conf_t   *blcf;
     ngx_buf_t                            buffer;
+    off_t                                total_length;
+    union {
+        uint32_t                         crc32;
+        uint64_t                         fnv1a;
+#if (NGX_OPENSSL)
+        EVP_MD_CTX                      *sha256;
+#endif
+    } hash;
+    ngx_str_t                            digest;
+    unsigned                             capture:1;
+    unsigned                             incomplete:1;
+    unsigned                             done:1;
 } ngx_http_response_body_ctx_t;
 
 
@@ -34,6 +62,18 @@ static ngx_int_t
 ngx_http_response_body_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 
+static ngx_int_t
+ngx_http_response_body_digest_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+
+static ngx_int_t
+ngx_http_response_body_total_length_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+
+static ngx_int_t
+ngx_http_response_body_truncated_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+
 static void *ngx_http_response_body_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_response_body_merge_loc_conf(ngx_conf_t *cf, void *parent,
     void *child);
@@ -82,6 +122,17 @@ ngx_http_next_body_filter_stub(ngx_http_request_t *r, ngx_chain_t *in)
 }
 
 
+static ngx_conf_enum_t  ngx_http_response_body_digest[] = {
+    { ngx_string("off"),    NGX_HTTP_RESPONSE_BODY_DIGEST_OFF },
+    { ngx_string("crc32"),  NGX_HTTP_RESPONSE_BODY_DIGEST_CRC32 },
+    { ngx_string("fnv1a"),  NGX_HTTP_RESPONSE_BODY_DIGEST_FNV1A },
+#if (NGX_OPENSSL)
+    { ngx_string("sha256"), NGX_HTTP_RESPONSE_BODY_DIGEST_SHA256 },
+#endif
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_http_response_body_commands[] = {
 
     { ngx_string("capture_response_body"),
@@ -168,6 +219,13 @@ static ngx_command_t  ngx_http_response_body_commands[] = {
       offsetof(ngx_http_response_body_loc_conf_t, buffer_size_multiplier),
       NULL },
 
+    { ngx_string("capture_response_body_digest"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_response_body_loc_conf_t, digest),
+      &ngx_http_response_body_digest },
+
       ngx_null_command
 
 };
@@ -210,6 +268,18 @@ static ngx_http_variable_t  ngx_http_upstream_vars[] = {
       ngx_http_response_body_variable, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("response_body_digest"), NULL,
+      ngx_http_response_body_digest_variable, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("response_body_total_length"), NULL,
+      ngx_http_response_body_total_length_variable, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("response_body_truncated"), NULL,
+      ngx_http_response_body_truncated_variable, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
 
 };
@@ -342,6 +412,84 @@ ngx_http_response_body_variable(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_response_body_digest_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_response_body_ctx_t *ctx;
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_response_body_module);
+    if (ctx == NULL || ctx->digest.data == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = ctx->digest.data;
+    v->len = ctx->digest.len;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_response_body_total_length_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_response_body_ctx_t *ctx;
+    u_char                       *p;
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_response_body_module);
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+    if (p == NULL)
+        return NGX_ERROR;
+
+    v->data = p;
+    v->len = ngx_sprintf(p, "%O", ctx->total_length) - p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_response_body_truncated_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_response_body_ctx_t *ctx;
+    ngx_buf_t                    *b;
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_response_body_module);
+    if (ctx == NULL || !ctx->capture) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    b = &ctx->buffer;
+
+    v->data = ctx->total_length > b->last - b->start ? (u_char *) "1"
+                                                     : (u_char *) "0";
+    v->len = 1;
+
+    return NGX_OK;
+}
+
+
 static char *
 ngx_http_response_body_request_var(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf)
@@ -378,10 +526,7 @@ ngx_http_response_body_create_loc_conf(ngx_conf_t *cf)
     blcf->buffer_size            = NGX_CONF_UNSET_SIZE;
     blcf->buffer_size_min        = NGX_CONF_UNSET_SIZE;
     blcf->buffer_size_multiplier = NGX_CONF_UNSET_UINT;
-    blcf->conditions             = ngx_array_create(cf->pool, 2,
-        sizeof(ngx_keyval_t));
-    blcf->cv                     = ngx_array_create(cf->pool, 2,
-        sizeof(ngx_http_complex_value_t));
+    blcf->digest                 = NGX_CONF_UNSET_UINT;
     blcf->status_1xx             = NGX_CONF_UNSET;
     blcf->status_2xx             = NGX_CONF_UNSET;
     blcf->status_3xx             = NGX_CONF_UNSET;
@@ -389,8 +534,12 @@ ngx_http_response_body_create_loc_conf(ngx_conf_t *cf)
     blcf->status_5xx             = NGX_CONF_UNSET;
     blcf->capture_body           = NGX_CONF_UNSET;
 
-    if (blcf->conditions == NULL || blcf->cv == NULL)
-        return NULL;
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     blcf->conditions = NULL;
+     *     blcf->cv = NULL;
+     */
 
     return blcf;
 }
@@ -417,16 +566,55 @@ ngx_array_merge(ngx_array_t *l, ngx_array_t *r)
 }
 
 
-static char *
-ngx_http_response_body_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+static ngx_array_t *
+ngx_http_response_body_compile_conditions(ngx_conf_t *cf,
+    ngx_array_t *conditions, ngx_uint_t n)
 {
-    ngx_http_response_body_loc_conf_t  *prev = parent;
-    ngx_http_response_body_loc_conf_t  *conf = child;
     ngx_http_compile_complex_value_t    ccv;
     ngx_http_complex_value_t           *cv;
+    ngx_array_t                        *a;
     ngx_uint_t                          j;
     ngx_keyval_t                       *kv;
 
+    a = ngx_array_create(cf->pool, n, sizeof(ngx_http_complex_value_t));
+    if (a == NULL)
+        return NULL;
+
+    kv = conditions->elts;
+
+    for (j = 0; j < conditions->nelts; j++) {
+
+        cv = ngx_array_push(a);
+        if (cv == NULL)
+            return NULL;
+
+        ngx_memzero(cv, sizeof(ngx_http_complex_value_t));
+        ngx_memzero(&ccv, sizeof(ccv));
+
+        ccv.cf = cf;
+        ccv.value = &kv[j].key;
+        ccv.complex_value = cv;
+        ccv.zero = 0;
+
+        if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+
+            ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                               "can't compile '%V'", &kv[j].key);
+            return NULL;
+        }
+    }
+
+    return a;
+}
+
+
+static char *
+ngx_http_response_body_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_response_body_loc_conf_t  *prev = parent;
+    ngx_http_response_body_loc_conf_t  *conf = child;
+    ngx_uint_t                          n;
+
     ngx_conf_merge_msec_value(conf->latency, prev->latency, (ngx_msec_int_t) 0);
     ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size,
                               (size_t) ngx_pagesize);
@@ -434,8 +622,8 @@ ngx_http_response_body_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
                               (size_t) ngx_pagesize);
     ngx_conf_merge_uint_value(conf->buffer_size_multiplier,
                               prev->buffer_size_multiplier, 2);
-    if (ngx_array_merge(conf->conditions, prev->conditions) == NGX_ERROR)
-        return NGX_CONF_ERROR;
+    ngx_conf_merge_uint_value(conf->digest, prev->digest,
+                              NGX_HTTP_RESPONSE_BODY_DIGEST_OFF);
     ngx_conf_merge_value(conf->status_1xx, prev->status_1xx, 0);
     ngx_conf_merge_value(conf->status_2xx, prev->status_2xx, 0);
     ngx_conf_merge_value(conf->status_3xx, prev->status_3xx, 0);
@@ -443,27 +631,43 @@ ngx_http_response_body_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->status_5xx, prev->status_5xx, 0);
     ngx_conf_merge_value(conf->capture_body, prev->capture_body, 0);
 
-    cv = ngx_array_push_n(conf->cv, conf->conditions->nelts);
-    if (cv == NULL)
-        return NGX_CONF_ERROR;
-    ngx_memzero(cv, conf->cv->size * conf->cv->nalloc);
-    kv = conf->conditions->elts;
+    if (prev->conditions != NULL && prev->cv == NULL) {
 
-    for (j = 0; j < conf->cv->nelts; j++) {
+        /* http{} level is never merged, compile its conditions once here */
 
-        ngx_memzero(&ccv, sizeof(ccv));
+        prev->cv = ngx_http_response_body_compile_conditions(cf,
+            prev->conditions, prev->conditions->nelts);
+        if (prev->cv == NULL)
+            return NGX_CONF_ERROR;
+    }
 
-        ccv.cf = cf;
-        ccv.value = &kv[j].key;
-        ccv.complex_value = &cv[j];
-        ccv.zero = 0;
+    if (conf->conditions == NULL) {
 
-        if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        /* share compiled conditions of the parent, they are immutable */
 
-            ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
-                               "can't compile '%V'", &kv[j].key);
+        conf->conditions = prev->conditions;
+        conf->cv = prev->cv;
+
+        return NGX_CONF_OK;
+    }
+
+    n = conf->conditions->nelts;
+
+    if (prev->conditions != NULL)
+        n += prev->conditions->nelts;
+
+    conf->cv = ngx_http_response_body_compile_conditions(cf,
+        conf->conditions, n);
+    if (conf->cv == NULL)
+        return NGX_CONF_ERROR;
+
+    if (prev->conditions != NULL) {
+
+        /* inherited conditions are already compiled, copy them as is */
+
+        if (ngx_array_merge(conf->conditions, prev->conditions) == NGX_ERROR
+            || ngx_array_merge(conf->cv, prev->cv) == NGX_ERROR)
             return NGX_CONF_ERROR;
-        }
     }
 
     return NGX_CONF_OK;
@@ -489,6 +693,193 @@ ngx_http_response_body_init(ngx_conf_t *cf)
 }
 
 
+#if (NGX_OPENSSL)
+
+static void
+ngx_http_response_body_sha256_cleanup(void *data)
+{
+    EVP_MD_CTX  *md = data;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    EVP_MD_CTX_free(md);
+#else
+    EVP_MD_CTX_destroy(md);
+#endif
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_response_body_digest_init(ngx_http_request_t *r,
+    ngx_http_response_body_ctx_t *ctx)
+{
+#if (NGX_OPENSSL)
+    ngx_pool_cleanup_t  *cln;
+    EVP_MD_CTX          *md;
+#endif
+
+    switch (ctx->blcf->digest) {
+
+        case NGX_HTTP_RESPONSE_BODY_DIGEST_CRC32:
+            ngx_crc32_init(ctx->hash.crc32);
+            break;
+
+        case NGX_HTTP_RESPONSE_BODY_DIGEST_FNV1A:
+            ctx->hash.fnv1a = NGX_HTTP_RESPONSE_BODY_FNV1A_OFFSET;
+            break;
+
+#if (NGX_OPENSSL)
+        case NGX_HTTP_RESPONSE_BODY_DIGEST_SHA256:
+            cln = ngx_pool_cleanup_add(r->pool, 0);
+            if (cln == NULL)
+                return NGX_ERROR;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+            md = EVP_MD_CTX_new();
+#else
+            md = EVP_MD_CTX_create();
+#endif
+            if (md == NULL)
+                return NGX_ERROR;
+
+            cln->handler = ngx_http_response_body_sha256_cleanup;
+            cln->data = md;
+
+            if (EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1)
+                return NGX_ERROR;
+
+            ctx->hash.sha256 = md;
+            break;
+#endif
+
+        default:
+            break;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_response_body_digest_update(ngx_http_response_body_ctx_t *ctx,
+    u_char *p, size_t len)
+{
+    u_char  *last;
+
+    switch (ctx->blcf->digest) {
+
+        case NGX_HTTP_RESPONSE_BODY_DIGEST_CRC32:
+            ngx_crc32_update(&ctx->hash.crc32, p, len);
+            break;
+
+        case NGX_HTTP_RESPONSE_BODY_DIGEST_FNV1A:
+            for (last = p + len; p < last; p++) {
+                ctx->hash.fnv1a ^= *p;
+                ctx->hash.fnv1a *= NGX_HTTP_RESPONSE_BODY_FNV1A_PRIME;
+            }
+            break;
+
+#if (NGX_OPENSSL)
+        case NGX_HTTP_RESPONSE_BODY_DIGEST_SHA256:
+            if (EVP_DigestUpdate(ctx->hash.sha256, p, len) != 1)
+                return NGX_ERROR;
+            break;
+#endif
+
+        default:
+            break;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_response_body_digest_final(ngx_http_request_t *r,
+    ngx_http_response_body_ctx_t *ctx)
+{
+    u_char  *p;
+#if (NGX_OPENSSL)
+    u_char   md[EVP_MAX_MD_SIZE];
+    u_int    len;
+#endif
+
+    ctx->done = 1;
+
+    if (ctx->blcf->digest == NGX_HTTP_RESPONSE_BODY_DIGEST_OFF
+        || ctx->incomplete)
+        /* buffers in file were not hashed, digest would lie */
+        return NGX_OK;
+
+    p = ngx_pnalloc(r->pool, NGX_HTTP_RESPONSE_BODY_DIGEST_LEN);
+    if (p == NULL)
+        return NGX_ERROR;
+
+    ctx->digest.data = p;
+
+    switch (ctx->blcf->digest) {
+
+        case NGX_HTTP_RESPONSE_BODY_DIGEST_CRC32:
+            ngx_crc32_final(ctx->hash.crc32);
+            p = ngx_sprintf(p, "%08xD", ctx->hash.crc32);
+            break;
+
+        case NGX_HTTP_RESPONSE_BODY_DIGEST_FNV1A:
+            p = ngx_sprintf(p, "%016xL", ctx->hash.fnv1a);
+            break;
+
+#if (NGX_OPENSSL)
+        case NGX_HTTP_RESPONSE_BODY_DIGEST_SHA256:
+            if (EVP_DigestFinal_ex(ctx->hash.sha256, md, &len) != 1)
+                return NGX_ERROR;
+            p = ngx_hex_dump(p, md, len);
+            break;
+#endif
+
+        default:
+            break;
+    }
+
+    ctx->digest.len = p - ctx->digest.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_response_body_update_stats(ngx_http_request_t *r,
+    ngx_http_response_body_ctx_t *ctx, ngx_chain_t *in)
+{
+    ngx_chain_t  *cl;
+    off_t         len;
+
+    for (cl = in; cl && !ctx->done; cl = cl->next) {
+
+        len = ngx_buf_size(cl->buf);
+
+        if (len != 0) {
+
+            if (ngx_buf_in_memory(cl->buf)) {
+
+                if (ngx_http_response_body_digest_update(ctx, cl->buf->pos,
+                        (size_t) len) != NGX_OK)
+                    return NGX_ERROR;
+
+            } else
+                ctx->incomplete = 1;
+
+            ctx->total_length += len;
+        }
+
+        if (cl->buf->last_buf || (cl->buf->last_in_chain && r != r->main))
+            return ngx_http_response_body_digest_final(r, ctx);
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_response_body_set_ctx(ngx_http_request_t *r)
 {
@@ -497,7 +888,8 @@ ngx_http_response_body_set_ctx(ngx_http_request_t *r)
 
     ulcf = ngx_http_get_module_loc_conf(r, ngx_http_response_body_module);
 
-    if (!ulcf->capture_body)
+    if (!ulcf->capture_body
+        && ulcf->digest == NGX_HTTP_RESPONSE_BODY_DIGEST_OFF)
         return NGX_DECLINED;
 
     ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_response_body_ctx_t));
@@ -505,6 +897,10 @@ ngx_http_response_body_set_ctx(ngx_http_request_t *r)
         return NGX_ERROR;
 
     ctx->blcf = ulcf;
+    ctx->capture = ulcf->capture_body ? 1 : 0;
+
+    if (ngx_http_response_body_digest_init(r, ctx) != NGX_OK)
+        return NGX_ERROR;
 
     ngx_http_set_ctx(r, ctx, ngx_http_response_body_module);
 
@@ -554,6 +950,9 @@ ngx_http_response_body_filter_header(ngx_http_request_t *r)
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_response_body_module);
 
+    if (!ctx->capture)
+        return ngx_http_next_header_filter(r);
+
     if (r->headers_out.status < 200) {
 
        if (ctx->blcf->status_1xx)
@@ -585,27 +984,35 @@ ngx_http_response_body_filter_header(ngx_http_request_t *r)
         && ctx->blcf->latency <= ngx_http_response_body_request_time(r))
         return ngx_http_next_header_filter(r);
 
-    cv = ctx->blcf->cv->elts;
-    kv = ctx->blcf->conditions->elts;
+    if (ctx->blcf->cv != NULL) {
 
-    for (j = 0; j < ctx->blcf->cv->nelts; ++j) {
+        cv = ctx->blcf->cv->elts;
+        kv = ctx->blcf->conditions->elts;
 
-        if (ngx_http_complex_value(r, &cv[j], &value) != NGX_OK)
-            continue;
+        for (j = 0; j < ctx->blcf->cv->nelts; ++j) {
 
-        if (value.len == 0)
-            continue;
+            if (ngx_http_complex_value(r, &cv[j], &value) != NGX_OK)
+                continue;
 
-        if (kv[j].value.len == 0
-            || (kv[j].value.len == 1 && kv[j].value.data[0] == '*'))
-            return ngx_http_next_header_filter(r);
+            if (value.len == 0)
+                continue;
 
-        if (kv[j].value.len == value.len
-            && ngx_strncasecmp(value.data, kv[j].value.data, value.len) == 0)
-            return ngx_http_next_header_filter(r);
+            if (kv[j].value.len == 0
+                || (kv[j].value.len == 1 && kv[j].value.data[0] == '*'))
+                return ngx_http_next_header_filter(r);
+
+            if (kv[j].value.len == value.len
+                && ngx_strncasecmp(value.data, kv[j].value.data,
+                                   value.len) == 0)
+                return ngx_http_next_header_filter(r);
+        }
     }
 
-    ngx_http_set_ctx(r, NULL, ngx_http_response_body_module);
+    if (ctx->blcf->digest == NGX_HTTP_RESPONSE_BODY_DIGEST_OFF)
+        ngx_http_set_ctx(r, NULL, ngx_http_response_body_module);
+    else
+        /* keep the statistics, skip only the capture */
+        ctx->capture = 0;
 
     return ngx_http_next_header_filter(r);
 }
@@ -625,6 +1032,12 @@ ngx_http_response_body_filter_body(ngx_http_request_t *r, ngx_chain_t *in)
     if (ctx == NULL)
         return ngx_http_next_body_filter(r, in);
 
+    if (ngx_http_response_body_update_stats(r, ctx, in) != NGX_OK)
+        return NGX_ERROR;
+
+    if (!ctx->capture)
+        return ngx_http_next_body_filter(r, in);
+
     conf = ngx_http_get_module_loc_conf(r, ngx_http_response_body_module);
 
     b = &ctx->buffer;